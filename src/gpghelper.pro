@@ -14,9 +14,11 @@ TEMPLATE = app
 RC_FILE = gpghelper.rc
 
 SOURCES += main.cpp\
-        mainwindow.cpp
+        mainwindow.cpp\
+        sessiontrace.cpp
 
-HEADERS  += mainwindow.h
+HEADERS  += mainwindow.h\
+        sessiontrace.h
 
 FORMS    += mainwindow.ui
 
@@ -21,12 +21,70 @@ SOFTWARE.
 */
 
 #include "mainwindow.h"
+#include "sessiontrace.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QMessageBox>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("A tool to help using SSH with GPG keys on Windows.");
+    parser.addHelpOption();
+    QCommandLineOption record_option("record", "Record gpg commands and files read into <trace>.", "trace");
+    QCommandLineOption replay_option("replay", "Replay <trace> instead of calling gpg.", "trace");
+    QCommandLineOption speed_option("replay-speed", "Replay speed factor (default 1, 0 for no wait).", "factor", "1");
+    QCommandLineOption anonymize_option("anonymize", "Anonymize <trace> into the file given by --output, then exit.", "trace");
+    QCommandLineOption output_option("output", "Output file for --anonymize.", "file");
+    parser.addOption(record_option);
+    parser.addOption(replay_option);
+    parser.addOption(speed_option);
+    parser.addOption(anonymize_option);
+    parser.addOption(output_option);
+    parser.process(a);
+
+    QString error;
+    if (parser.isSet(anonymize_option))
+    {
+        if (!parser.isSet(output_option))
+        {
+            error = "--anonymize requires --output";
+        }
+        else if (SessionTrace::anonymize(parser.value(anonymize_option), parser.value(output_option), error))
+        {
+            QMessageBox::information(nullptr, "GPG Helper", "Anonymized trace written to " + parser.value(output_option));
+            return 0;
+        }
+        QMessageBox::critical(nullptr, "GPG Helper", error);
+        return 1;
+    }
+
     MainWindow w;
+    bool speed_ok = false;
+    double speed = parser.value(speed_option).toDouble(&speed_ok);
+    if (parser.isSet(record_option) && parser.isSet(replay_option))
+    {
+        error = "--record and --replay cannot be used together";
+    }
+    else if (!speed_ok || speed < 0)
+    {
+        error = "Invalid replay speed " + parser.value(speed_option);
+    }
+    else if (parser.isSet(record_option))
+    {
+        w.record_trace(parser.value(record_option), error);
+    }
+    else if (parser.isSet(replay_option))
+    {
+        w.replay_trace(parser.value(replay_option), speed, error);
+    }
+    if (!error.isEmpty())
+    {
+        QMessageBox::critical(nullptr, "GPG Helper", error);
+        return 1;
+    }
     w.show();
 
     return a.exec();
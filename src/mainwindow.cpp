@@ -27,10 +27,25 @@ SOFTWARE.
 #include <QScrollBar>
 #include <QFile>
 #include <QTextStream>
+#include <QFileInfo>
+#include <QSignalBlocker>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QCryptographicHash>
+
+// Files of gpg home directory monitored for changes made outside of the tool
+static const char* KEYBOX_FILE = "pubring.kbx";
+static const char* SSHCONTROL_FILE = "sshcontrol";
+static const char* AGENT_CONF_FILE = "gpg-agent.conf";
+static const char* PRIVATE_KEYS_DIR = "private-keys-v1.d";
+// Delay (ms) before reloading, so that a burst of writes triggers only one reload
+static const int WATCH_DEBOUNCE_MS = 500;
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow)
+    ui(new Ui::MainWindow),
+    keys_queried(false),
+    sshcontrol_queried(false)
 {
     ui->setupUi(this);
     ui->listWidgetKeys->setSelectionMode(QAbstractItemView::SingleSelection);
@@ -38,6 +53,22 @@ MainWindow::MainWindow(QWidget *parent) :
     copyright_label->setText(QString("(c) 2019 - Mathieu Allory - Under MIT License - Build %1:%2").arg(__DATE__).arg(__TIME__));
     statusBar()->addPermanentWidget(copyright_label);
 
+    // Watch gpg home directory, each kind of change has its own debounced reload
+    watcher = new QFileSystemWatcher(this);
+    connect(watcher, &QFileSystemWatcher::fileChanged, this, &MainWindow::watched_file_changed);
+    connect(watcher, &QFileSystemWatcher::directoryChanged, this, &MainWindow::watched_dir_changed);
+    keybox_timer = new QTimer(this);
+    sshcontrol_timer = new QTimer(this);
+    agent_conf_timer = new QTimer(this);
+    for (QTimer* t : QList<QTimer*>() << keybox_timer << sshcontrol_timer << agent_conf_timer)
+    {
+        t->setSingleShot(true);
+        t->setInterval(WATCH_DEBOUNCE_MS);
+    }
+    connect(keybox_timer, &QTimer::timeout, this, &MainWindow::reload_keybox);
+    connect(sshcontrol_timer, &QTimer::timeout, this, &MainWindow::reload_sshcontrol);
+    connect(agent_conf_timer, &QTimer::timeout, this, &MainWindow::reload_agent_conf);
+
     refresh_gui_buttons();
 }
 
@@ -54,29 +85,199 @@ void MainWindow::on_pushButtonGpgCheck_clicked()
     QRegularExpression rx2(".*(Home: )(?<home>.*)\r.*");
     gpg_dir = rx2.match(result).captured("home");
     ui->lineEditGpgHome->setText(gpg_dir);
+    watch_gpg_dir();
 
     refresh_gui_buttons();
 }
 
 QString MainWindow::execute(const QString& i_command, const QStringList& i_args)
 {
-    QProcess process;
+    return execute_concurrently(i_command, QList<QStringList>() << i_args).first();
+}
+
+QStringList MainWindow::execute_concurrently(const QString& i_command, const QList<QStringList>& i_args_list, QList<int>* o_exit_codes)
+{
     statusBar()->showMessage("Running " + i_command);
-    process.start(i_command, i_args);
-    // Wait until finished (10 sec)
-    if(!process.waitForFinished(10000))
+    QList<SessionTrace::command_event> events;
+    if (trace.mode() == SessionTrace::replay)
+    {
+        events = replay_processes(i_command, i_args_list);
+    }
+    else
+    {
+        events = run_processes(i_command, i_args_list);
+    }
+
+    // Collect outputs, in order
+    QStringList results;
+    bool timeout = false;
+    for (const SessionTrace::command_event& event : events)
+    {
+        // -1 when the command did not finish
+        if (o_exit_codes) o_exit_codes->append(event.timeout ? -1 : event.exit_code);
+        if (event.timeout)
+        {
+            timeout = true;
+            results.append("");
+            continue;
+        }
+        QString read_data = QTextCodec::codecForMib(2252)->toUnicode(event.out);
+        read_data += QTextCodec::codecForMib(2252)->toUnicode(event.err);
+        log_text("[" + i_command + (event.args.empty() ? "" : " ") + event.args.join(" ") + "]\n", true);
+        log_text(read_data);
+        results.append(read_data);
+    }
+
+    if (timeout)
     {
         statusBar()->showMessage("Could not run " + i_command + ": timeout");
-        return "";
     }
-    statusBar()->clearMessage();
+    else
+    {
+        statusBar()->clearMessage();
+    }
+    return results;
+}
+
+QList<SessionTrace::command_event> MainWindow::run_processes(const QString& i_command, const QList<QStringList>& i_args_list)
+{
+    // Start all processes first, so that they run at the same time
+    QList<QProcess*> processes;
+    QList<SessionTrace::command_event> events;
+    QElapsedTimer clock;
+    clock.start();
+    qint64 start_ms = trace.elapsed();
+    for (const QStringList& args : i_args_list)
+    {
+        QProcess* process = new QProcess();
+        process->start(i_command, args);
+        processes.append(process);
+        SessionTrace::command_event event;
+        event.command = i_command;
+        event.args = args;
+        event.timeout = true;
+        event.start_ms = start_ms;
+        events.append(event);
+    }
+
+    // Wait until all finished (10 sec), polling so that each one is timed on its own
+    QVector<bool> done(processes.size(), false);
+    int remaining = processes.size();
+    while (remaining > 0 && clock.elapsed() < 10000)
+    {
+        for (int i = 0; i < processes.size(); i++)
+        {
+            if (done[i]) continue;
+            QProcess* process = processes[i];
+            if (process->waitForFinished(10) || process->state() == QProcess::NotRunning)
+            {
+                done[i] = true;
+                remaining--;
+                events[i].duration_ms = clock.elapsed();
+                // Could not start at all: same as a timeout
+                if (process->error() != QProcess::FailedToStart)
+                {
+                    events[i].timeout = false;
+                    events[i].exit_code = process->exitCode();
+                    events[i].out = process->readAll();
+                    events[i].err = process->readAllStandardError();
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < processes.size(); i++)
+    {
+        if (!done[i])
+        {
+            processes[i]->kill();
+            processes[i]->waitForFinished();
+            events[i].duration_ms = clock.elapsed();
+        }
+        delete processes[i];
+        trace.record_command(events[i]);
+    }
+    return events;
+}
+
+QList<SessionTrace::command_event> MainWindow::replay_processes(const QString& i_command, const QList<QStringList>& i_args_list)
+{
+    QList<SessionTrace::command_event> events;
+    qint64 duration_ms = 0;
+    for (const QStringList& args : i_args_list)
+    {
+        SessionTrace::command_event event;
+        if (!trace.replay_command(i_command, args, event))
+        {
+            log_text("ERROR: [" + i_command + (args.empty() ? "" : " ") + args.join(" ") + "] not found in trace\n", true);
+            event.command = i_command;
+            event.args = args;
+            event.timeout = true;
+        }
+        // Processes ran at the same time: wait for the longest one
+        duration_ms = qMax(duration_ms, event.duration_ms);
+        events.append(event);
+    }
+    trace.wait(duration_ms);
+    return events;
+}
+
+bool MainWindow::read_file(const QString& i_path, QByteArray& o_data, bool& o_exists)
+{
+    SessionTrace::file_event event;
+    if (trace.mode() == SessionTrace::replay)
+    {
+        if (!trace.replay_file(i_path, event))
+        {
+            log_text("ERROR: " + i_path + " not found in trace\n", true);
+        }
+        trace.wait(event.duration_ms);
+    }
+    else
+    {
+        QElapsedTimer clock;
+        clock.start();
+        QFile file(i_path);
+        event.start_ms = trace.elapsed();
+        event.path = i_path;
+        event.exists = file.exists();
+        event.readable = event.exists && file.open(QIODevice::ReadOnly);
+        if (event.readable)
+        {
+            event.data = file.readAll();
+            file.close();
+        }
+        event.duration_ms = clock.elapsed();
+        trace.record_file(event);
+    }
 
-    QString read_data = QTextCodec::codecForMib(2252)->toUnicode(process.readAll());
-    read_data += QTextCodec::codecForMib(2252)->toUnicode(process.readAllStandardError());
-    log_text("[" + i_command + (i_args.empty() ? "" : " ") + i_args.join(" ") + "]\n", true);
-    log_text(read_data);
+    o_data = event.data;
+    o_exists = event.exists;
+    return event.readable;
+}
 
-    return read_data;
+bool MainWindow::record_trace(const QString& i_file, QString& o_error)
+{
+    if (!trace.start_recording(i_file))
+    {
+        o_error = trace.error();
+        return false;
+    }
+    log_text("Recording session to " + i_file + "\n", true);
+    statusBar()->addPermanentWidget(new QLabel("[recording]", this));
+    return true;
+}
+
+bool MainWindow::replay_trace(const QString& i_file, double i_speed, QString& o_error)
+{
+    if (!trace.start_replay(i_file, i_speed))
+    {
+        o_error = trace.error();
+        return false;
+    }
+    log_text("Replaying session from " + i_file + " - gpg is not called and files are not modified\n", true);
+    statusBar()->addPermanentWidget(new QLabel("[replay]", this));
+    return true;
 }
 
 void MainWindow::log_text(const QString& i_text, bool i_new_paragraph)
@@ -150,7 +351,9 @@ void MainWindow::refresh_gui_buttons()
         {
             if (k->hash == key_hash && k->sshcontrol == key::unauthorized)
             {
-                can_authorize_key = true;
+                // Do not offer keys that would fail at ssh login
+                const sub* ssh_sub = k->auth_sub();
+                can_authorize_key = (ssh_sub != nullptr && ssh_sub->can_sign());
                 break;
             }
         }
@@ -174,15 +377,27 @@ void MainWindow::on_pushButtonClearFields_clicked()
     ui->lineEditRawSshKey->clear();
     ui->lineEditStrippedSshKey->clear();
     clear_keys();
+    unwatch_gpg_dir();
     gpg_dir.clear();
     sshcontrol.clear();
+    keys_queried = false;
+    sshcontrol_queried = false;
     refresh_gui_buttons();
 }
 
 void MainWindow::on_pushButtonKeysQuery_clicked()
 {
     clear_keys();
-    QStringList result = execute("gpg", QStringList() << "--with-keygrip" << "--fingerprint" << "--fingerprint" << "-k").split("\r\n");
+    keys_queried = true;
+    // Public and secret keys are listed at the same time, then joined on keygrip
+    QList<int> exit_codes;
+    QStringList listings = execute_concurrently("gpg", QList<QStringList>()
+        << (QStringList() << "--with-keygrip" << "--fingerprint" << "--fingerprint" << "-k")
+        << (QStringList() << "--with-keygrip" << "-K"), &exit_codes);
+    // A failed secret listing does not mean that keys have no secret
+    bool secrets_known = (exit_codes[1] == 0);
+    QStringList result = listings[0].split("\r\n");
+    QHash<QString, sub::secret_t> secret_grips = parse_secret_grips(listings[1].split("\r\n"));
 
     // Small state machine to parse the list of keys
     bool in_key_group = false;
@@ -293,13 +508,28 @@ void MainWindow::on_pushButtonKeysQuery_clicked()
     }
     // Might leak of one key(), doesn't really matter
 
+    // Tell which subkeys have secret material (unknown grips have none)
+    if (!secrets_known)
+    {
+        log_text("ERROR: cannot list secret keys, availability of secret keys is unknown\n", true);
+    }
+    for (key* k : keys)
+    {
+        for (sub& s : k->subs)
+        {
+            s.secret = secrets_known ? secret_grips.value(s.grip, sub::no_secret) : sub::unknown;
+        }
+    }
+
     // Log results - in log window
     for (key* k : keys)
     {
         log_text(k->hash + "\n");
         for (sub s : k->subs)
         {
-            log_text("- " + s.algo + (s.auth ? " AUTH " : " NO-AUTH ") + s.grip + " " + s.fingerprint + "\n");
+            QString secret = (s.secret == sub::local) ? " SECRET " : (s.secret == sub::card) ? " CARD " :
+                             (s.secret == sub::unknown) ? " SECRET? " : " NO-SECRET ";
+            log_text("- " + s.algo + (s.auth ? " AUTH" : " NO-AUTH") + secret + s.grip + " " + s.fingerprint + "\n");
         }
         for (uid u : k->uids)
         {
@@ -307,8 +537,15 @@ void MainWindow::on_pushButtonKeysQuery_clicked()
         }
     }
 
-    // Update widget content
-    update_list_of_keys_from_struct();
+    // Update widget content, keeping ssh status if sshcontrol was already read
+    if (sshcontrol_queried)
+    {
+        apply_sshcontrol();
+    }
+    else
+    {
+        update_list_of_keys_from_struct();
+    }
     return;
 
 error:
@@ -318,22 +555,18 @@ error:
 
 void MainWindow::update_list_of_keys_from_struct()
 {
+    // Keep the current selection, without re-exporting the same ssh key
+    QSignalBlocker blocker(ui->listWidgetKeys);
+    QString selected_hash;
+    if (ui->listWidgetKeys->currentItem())
+    {
+        selected_hash = ui->listWidgetKeys->currentItem()->data(Qt::UserRole).toString();
+    }
     ui->listWidgetKeys->clear();
     // Log results - in log window + in the list widget
     for (key* k : keys)
     {
         QString key_digest = k->hash;
-        QString key_auth_grip;
-        bool can_auth = false;
-        for (sub s : k->subs)
-        {
-            // Does this key has a subkey that can authenticate ?
-            if (s.auth)
-            {
-                can_auth = true;
-                key_auth_grip = s.grip;
-            }
-        }
         QStringList names;
         for (uid u : k->uids)
         {
@@ -346,16 +579,54 @@ void MainWindow::update_list_of_keys_from_struct()
         if (k->sshcontrol == key::unknown) key_digest += " [ssh: unknown]";
         else if (k->sshcontrol == key::authorized) key_digest += " [ssh: authorized]";
         else if (k->sshcontrol == key::unauthorized) key_digest += " [ssh: not authorized]";
+        // Does this key has a subkey that can authenticate, with its secret ?
+        const sub* ssh_sub = k->auth_sub();
+        if (ssh_sub == nullptr) key_digest += " [no auth subkey]";
+        else if (!ssh_sub->can_sign()) key_digest += " [no secret key]";
+        else if (ssh_sub->secret == sub::card) key_digest += " [on card]";
 
         QListWidgetItem *newItem = new QListWidgetItem;
         newItem->setText(key_digest);
         newItem->setData(Qt::UserRole, k->hash);
         ui->listWidgetKeys->addItem(newItem);
+        if (!selected_hash.isEmpty() && k->hash == selected_hash)
+        {
+            ui->listWidgetKeys->setCurrentItem(newItem);
+        }
     }
 
     refresh_gui_buttons();
 }
 
+QHash<QString, sub::secret_t> MainWindow::parse_secret_grips(const QStringList& i_lines)
+{
+    // Only keep the grip of each secret (sub)key, and where its secret is:
+    // "sec"/"ssb" is followed by '#' when the secret is not available,
+    // and by '>' when it is a stub for a key stored on a card
+    QHash<QString, sub::secret_t> grips;
+    sub::secret_t current = sub::no_secret;
+    QRegularExpression rx_grip("^[ ]{6}Keygrip = (?<grip>.*)");
+    for (const QString& line : i_lines)
+    {
+        if ((line.startsWith("sec") || line.startsWith("ssb")) && line.size() > 3)
+        {
+            if (line[3] == '#') current = sub::no_secret;
+            else if (line[3] == '>') current = sub::card;
+            else current = sub::local;
+        }
+        else if (line.contains("Keygrip"))
+        {
+            QString grip = rx_grip.match(line).captured("grip");
+            if (!grip.isEmpty() && current != sub::no_secret)
+            {
+                grips.insert(grip, current);
+            }
+            current = sub::no_secret;
+        }
+    }
+    return grips;
+}
+
 sub MainWindow::parse_key_sub(const QString& i_line)
 {
     QRegularExpression rx_pub("^(pub|sub)[ ]{3}(?<algo>.*) \\[(?<capa>[A-Z]+)\\]");
@@ -374,6 +645,7 @@ void MainWindow::on_listWidgetKeys_currentItemChanged(QListWidgetItem *current,
 
     QString fingerprint, fingerprint_auth, result;
     QStringList tok_key;
+    bool secret_available = false;
 
     if (current == nullptr)
     {
@@ -387,16 +659,10 @@ void MainWindow::on_listWidgetKeys_currentItemChanged(QListWidgetItem *current,
     // not necessarily the one from the [A] key - so get the right one
     for (key* k : keys)
     {
-        if (k->hash == fingerprint)
+        if (k->hash == fingerprint && k->auth_sub())
         {
-            for(sub s: k->subs)
-            {
-                if (s.auth)
-                {
-                    fingerprint_auth = s.fingerprint;
-                    break;
-                }
-            }
+            fingerprint_auth = k->auth_sub()->fingerprint;
+            secret_available = k->auth_sub()->can_sign();
         }
     }
 
@@ -410,6 +676,11 @@ void MainWindow::on_listWidgetKeys_currentItemChanged(QListWidgetItem *current,
         goto go_out;
     }
 
+    if (!secret_available)
+    {
+        log_text("WARNING: no secret key available for the auth subkey of " + fingerprint + ", ssh login with it will fail\n", true);
+    }
+
     result = execute("gpg", QStringList() << "--export-ssh-key" << fingerprint_auth + "!");
     ui->lineEditRawSshKey->setText(result);
     ui->lineEditRawSshKey->setEnabled(true);
@@ -437,61 +708,79 @@ void MainWindow::clear_keys()
 void MainWindow::on_pushButtonQuerySshControl_clicked()
 {
     if (gpg_dir.isEmpty()) return;
+    read_sshcontrol();
+    sshcontrol_queried = true;
+    apply_sshcontrol();
+    refresh_gui_buttons();
+}
+
+void MainWindow::read_sshcontrol()
+{
     sshcontrol.clear();
-    // First, set all keys to unauthorized
-    for (key* k : keys)
-    {
-        k->sshcontrol = key::unauthorized;
-    }
 
-    QFile ctrl_file(gpg_dir + "/sshcontrol");
-    if (!ctrl_file.exists())
+    QString ctrl_file_name = gpg_dir + "/" + SSHCONTROL_FILE;
+    QByteArray data;
+    bool exists = false;
+    bool readable = read_file(ctrl_file_name, data, exists);
+    if (!exists)
     {
         log_text("sshcontrol file does not yet exist (will be created)\n", true);
-        goto go_out;
+        return;
     }
 
-    if (ctrl_file.open(QIODevice::ReadOnly))
+    if (readable)
     {
-        log_text("Content of " + ctrl_file.fileName() + ":\n", true);
-        QTextStream in(&ctrl_file);
-
-        // Then loop on actual data and set to authorized those found in file
+        log_text("Content of " + ctrl_file_name + ":\n", true);
+        QTextStream in(data);
         while (!in.atEnd())
         {
            QString found_key = in.readLine();
            log_text(found_key + "\n");
-
-           // Update status of known keys
-           for (key* k : keys)
-           {
-               for (sub s: k->subs)
-               {
-                   if (s.grip == found_key)
-                   {
-                       k->sshcontrol = key::authorized;
-                   }
-               }
-           }
+           sshcontrol.append(found_key);
         }
-        ctrl_file.close();
     }
     else
     {
-        log_text("ERROR: Cannot open " + ctrl_file.fileName() + "\n");
+        log_text("ERROR: Cannot open " + ctrl_file_name + "\n");
+    }
+}
+
+void MainWindow::apply_sshcontrol()
+{
+    // First, set all keys to unauthorized
+    for (key* k : keys)
+    {
+        k->sshcontrol = key::unauthorized;
+    }
+
+    // Then set to authorized those with a grip found in sshcontrol
+    for (key* k : keys)
+    {
+        for (sub s: k->subs)
+        {
+            if (sshcontrol.contains(s.grip))
+            {
+                k->sshcontrol = key::authorized;
+            }
+        }
     }
 
-go_out:
     update_list_of_keys_from_struct();
-    refresh_gui_buttons();
 }
 
 void MainWindow::on_pushButtonAuthorizeKey_clicked()
 {
     if (ui->listWidgetKeys->currentItem())
     {
+        if (trace.mode() == SessionTrace::replay)
+        {
+            log_text("Replay: sshcontrol is not modified\n", true);
+            on_pushButtonQuerySshControl_clicked();
+            return;
+        }
+
         // First try to open the file
-        QFile ssh_control_file(gpg_dir + "/sshcontrol");
+        QFile ssh_control_file(gpg_dir + "/" + SSHCONTROL_FILE);
         ssh_control_file.open(QIODevice::Append | QIODevice::Text);
         if (!ssh_control_file.isOpen())
         {
@@ -506,23 +795,24 @@ void MainWindow::on_pushButtonAuthorizeKey_clicked()
             if (k->hash == key_hash && k->sshcontrol == key::unauthorized)
             {
                 // OK, we found the key, let's do this.
-                // Get the grip of the first subkey that can authenticate
+                // Get the grip of the first subkey that can authenticate and sign
                 for(sub s : k->subs)
                 {
-                    if (s.auth && !s.grip.isEmpty())
+                    if (s.auth && s.can_sign() && !s.grip.isEmpty())
                     {
                         // gotcha !
                         log_text("Adding grip " + s.grip + " for fingerprint " + k->hash + " to ssh control file " + ssh_control_file.fileName() + "\n", true);
                         QTextStream out(&ssh_control_file);
                         out << s.grip << endl;
                         ssh_control_file.close();
+                        mark_own_write(ssh_control_file.fileName());
                         // Refresh screen
                         on_pushButtonQuerySshControl_clicked();
                         return;
                     }
                 }
                 // If we are still here, it means we found no suitable key
-                log_text("No suitable key (allowing authentication) found for fingerprint " + k->hash + " \n", true);
+                log_text("No suitable key (allowing authentication, with secret available) found for fingerprint " + k->hash + " \n", true);
             }
         }
         ssh_control_file.close();
@@ -543,9 +833,17 @@ void MainWindow::on_pushButtonStrippedSshKeyCopy_clicked()
 
 void MainWindow::on_pushButtonAgentEnablePutty_clicked()
 {
+    if (trace.mode() == SessionTrace::replay)
+    {
+        log_text("Replay: gpg-agent.conf is not modified\n", true);
+        this->on_pushButtonAgentGetConfig_clicked();
+        this->on_pushButtonAgentRestart_clicked();
+        return;
+    }
+
     // Append enable-putty-support at the end of gpg-agent.conf
     // First try to open the file
-    QFile gpg_conf_file(gpg_dir + "/gpg-agent.conf");
+    QFile gpg_conf_file(gpg_dir + "/" + AGENT_CONF_FILE);
     gpg_conf_file.open(QIODevice::Append | QIODevice::Text);
     if (!gpg_conf_file.isOpen())
     {
@@ -557,9 +855,155 @@ void MainWindow::on_pushButtonAgentEnablePutty_clicked()
     QTextStream out(&gpg_conf_file);
     out << "enable-putty-support" << endl;
     gpg_conf_file.close();
+    mark_own_write(gpg_conf_file.fileName());
 
     // Reload configuration
     this->on_pushButtonAgentGetConfig_clicked();
     // Restart agent
     this->on_pushButtonAgentRestart_clicked();
 }
+
+void MainWindow::watch_gpg_dir()
+{
+    unwatch_gpg_dir();
+    // When replaying, the gpg home directory is the one of the recorded session
+    if (gpg_dir.isEmpty() || trace.mode() == SessionTrace::replay) return;
+
+    // The directory itself is watched too: files may not exist yet,
+    // and some editors replace the file instead of writing into it
+    watcher->addPath(gpg_dir);
+    // Secret keys are one file each, adding/removing one changes the directory
+    if (QFileInfo(gpg_dir + "/" + PRIVATE_KEYS_DIR).isDir()) watcher->addPath(gpg_dir + "/" + PRIVATE_KEYS_DIR);
+    for (const char* name : { KEYBOX_FILE, SSHCONTROL_FILE, AGENT_CONF_FILE })
+    {
+        QString path = gpg_dir + "/" + name;
+        if (QFile::exists(path)) watcher->addPath(path);
+    }
+}
+
+void MainWindow::unwatch_gpg_dir()
+{
+    if (!watcher->files().isEmpty()) watcher->removePaths(watcher->files());
+    if (!watcher->directories().isEmpty()) watcher->removePaths(watcher->directories());
+    keybox_timer->stop();
+    sshcontrol_timer->stop();
+    agent_conf_timer->stop();
+}
+
+QTimer* MainWindow::reload_timer_for(const QString& i_path)
+{
+    QString name = QFileInfo(i_path).fileName();
+    if (name == KEYBOX_FILE) return keybox_timer;
+    if (name == SSHCONTROL_FILE) return sshcontrol_timer;
+    if (name == AGENT_CONF_FILE) return agent_conf_timer;
+    return nullptr;
+}
+
+void MainWindow::watched_file_changed(const QString& i_path)
+{
+    // A file replaced on disk is dropped from the watcher, so add it again
+    if (!watcher->files().contains(i_path) && QFile::exists(i_path))
+    {
+        watcher->addPath(i_path);
+    }
+
+    // Our own writes are already followed by an explicit refresh
+    if (take_own_write(i_path)) return;
+
+    // (Re)start the debounce timer, reload happens once writes are over
+    QTimer* timer = reload_timer_for(i_path);
+    if (timer) timer->start();
+}
+
+void MainWindow::watched_dir_changed(const QString& i_path)
+{
+    // Secret keys added or removed: keys must be listed again
+    if (QFileInfo(i_path).fileName() == PRIVATE_KEYS_DIR)
+    {
+        keybox_timer->start();
+        return;
+    }
+
+    // Secret keys directory created by gpg in the meantime
+    QString private_keys_dir = gpg_dir + "/" + PRIVATE_KEYS_DIR;
+    if (QFileInfo(private_keys_dir).isDir() && !watcher->directories().contains(private_keys_dir))
+    {
+        watcher->addPath(private_keys_dir);
+        keybox_timer->start();
+    }
+
+    // Pick up watched files that were created (or re-created) in the meantime
+    for (const char* name : { KEYBOX_FILE, SSHCONTROL_FILE, AGENT_CONF_FILE })
+    {
+        QString path = gpg_dir + "/" + name;
+        if (QFile::exists(path) && !watcher->files().contains(path))
+        {
+            watcher->addPath(path);
+            if (!take_own_write(path)) reload_timer_for(path)->start();
+        }
+    }
+}
+
+// Hash of the content of a (small) file, empty if it cannot be read
+static QByteArray file_hash(const QString& i_path)
+{
+    QFile file(i_path);
+    if (!file.open(QIODevice::ReadOnly)) return QByteArray();
+    return QCryptographicHash::hash(file.readAll(), QCryptographicHash::Sha1);
+}
+
+void MainWindow::mark_own_write(const QString& i_path)
+{
+    // Remember the content we left, the watcher will notify us later on
+    own_writes[i_path] = file_hash(i_path);
+    QTimer* timer = reload_timer_for(i_path);
+    if (timer) timer->stop();
+}
+
+bool MainWindow::take_own_write(const QString& i_path)
+{
+    // Only the first event after our write is ours: later ones are external changes
+    if (!own_writes.contains(i_path)) return false;
+    QByteArray hash = own_writes.take(i_path);
+    return !hash.isEmpty() && hash == file_hash(i_path);
+}
+
+void MainWindow::reload_keybox()
+{
+    // Nothing to refresh if keys were never listed
+    if (!keys_queried) return;
+    log_text("Keyring changed, reloading keys\n", true);
+
+    // Listing keys again starts from an empty list: select the same key afterwards
+    QString selected_hash;
+    if (ui->listWidgetKeys->currentItem())
+    {
+        selected_hash = ui->listWidgetKeys->currentItem()->data(Qt::UserRole).toString();
+    }
+    on_pushButtonKeysQuery_clicked();
+    for (int i = 0; i < ui->listWidgetKeys->count() && !selected_hash.isEmpty(); i++)
+    {
+        if (ui->listWidgetKeys->item(i)->data(Qt::UserRole).toString() == selected_hash)
+        {
+            // Exports the ssh key again, it may have changed with the keyring
+            ui->listWidgetKeys->setCurrentRow(i);
+            break;
+        }
+    }
+}
+
+void MainWindow::reload_sshcontrol()
+{
+    // Only the ssh status of keys depends on sshcontrol: no need to call gpg again
+    if (!sshcontrol_queried) return;
+    read_sshcontrol();
+    apply_sshcontrol();
+}
+
+void MainWindow::reload_agent_conf()
+{
+    // Nothing to refresh if the agent config was never read
+    if (ui->lineEditPageantSupport->text().isEmpty()) return;
+    log_text(QString(AGENT_CONF_FILE) + " changed, reloading agent configuration\n", true);
+    on_pushButtonAgentGetConfig_clicked();
+}
@@ -25,6 +25,10 @@ SOFTWARE.
 
 #include <QMainWindow>
 #include <QListWidgetItem>
+#include <QHash>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include "sessiontrace.h"
 
 namespace Ui {
 class MainWindow;
@@ -43,10 +47,28 @@ struct sub
     QString algo;
     bool auth;
     QString grip;
+    // Secret material available for this subkey (from gpg -K)
+    enum secret_t
+    {
+        no_secret,
+        local,
+        card,
+        // Secret keys could not be listed
+        unknown
+    };
+    secret_t secret;
 
     sub()
     {
         auth = false;
+        secret = no_secret;
+    }
+
+    // A subkey without secret material cannot sign ssh challenges
+    // (when unknown, let the user try)
+    bool can_sign() const
+    {
+        return secret != no_secret;
     }
 };
 
@@ -68,6 +90,18 @@ struct key
     {
         sshcontrol = unknown;
     }
+
+    // First subkey able to authenticate, preferably one that can sign
+    const sub* auth_sub() const
+    {
+        const sub* found = nullptr;
+        for (const sub& s : subs)
+        {
+            if (s.auth && s.can_sign()) return &s;
+            if (s.auth && found == nullptr) found = &s;
+        }
+        return found;
+    }
 };
 
 class MainWindow : public QMainWindow
@@ -78,6 +112,10 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
+    // Capture of the session into a trace, or replay of such a trace instead of calling gpg
+    bool record_trace(const QString& i_file, QString& o_error);
+    bool replay_trace(const QString& i_file, double i_speed, QString& o_error);
+
 private slots:
     void on_pushButtonGpgCheck_clicked();
 
@@ -107,17 +145,53 @@ private slots:
 
     void on_pushButtonAgentEnablePutty_clicked();
 
+    void watched_file_changed(const QString& i_path);
+
+    void watched_dir_changed(const QString& i_path);
+
+    void reload_keybox();
+
+    void reload_sshcontrol();
+
+    void reload_agent_conf();
+
 private:
+    QStringList execute_concurrently(const QString& i_command, const QList<QStringList>& i_args_list, QList<int>* o_exit_codes = nullptr);
+    QList<SessionTrace::command_event> run_processes(const QString& i_command, const QList<QStringList>& i_args_list);
+    QList<SessionTrace::command_event> replay_processes(const QString& i_command, const QList<QStringList>& i_args_list);
+    bool read_file(const QString& i_path, QByteArray& o_data, bool& o_exists);
     sub parse_key_sub(const QString& i_line);
+    QHash<QString, sub::secret_t> parse_secret_grips(const QStringList& i_lines);
     void clear_keys();
     void update_list_of_keys_from_struct();
     void refresh_gui_buttons();
+    void read_sshcontrol();
+    void apply_sshcontrol();
+    void watch_gpg_dir();
+    void unwatch_gpg_dir();
+    QTimer* reload_timer_for(const QString& i_path);
+    void mark_own_write(const QString& i_path);
+    bool take_own_write(const QString& i_path);
 
 private:
     Ui::MainWindow *ui;
     QList<key*> keys;
     QString gpg_dir;
     QStringList sshcontrol;
+    // Set once the user queried keys / sshcontrol, so that external
+    // changes only refresh what is actually displayed
+    bool keys_queried;
+    bool sshcontrol_queried;
+    // Monitoring of the files in gpg home directory
+    QFileSystemWatcher* watcher;
+    // One debounce timer per kind of change (editors write in bursts)
+    QTimer* keybox_timer;
+    QTimer* sshcontrol_timer;
+    QTimer* agent_conf_timer;
+    // Content hash of files just written by the tool itself
+    QHash<QString, QByteArray> own_writes;
+    // Record / replay of gpg commands and files read
+    SessionTrace trace;
 };
 
 #endif // MAINWINDOW_H
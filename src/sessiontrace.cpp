@@ -0,0 +1,467 @@
+/*
+Copyright (c) 2019 - Mathieu ALLORY
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "sessiontrace.h"
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QRegularExpression>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QThread>
+#include <QUuid>
+#include <QPair>
+#include <functional>
+#include <algorithm>
+
+static const int TRACE_VERSION = 1;
+
+// Byte streams are kept as Latin-1 text, which is lossless and keeps the trace readable
+static QString to_text(const QByteArray& i_data)
+{
+    return QString::fromLatin1(i_data);
+}
+
+static QByteArray from_text(const QJsonValue& i_value)
+{
+    return i_value.toString().toLatin1();
+}
+
+static QStringList to_string_list(const QJsonArray& i_array)
+{
+    QStringList list;
+    for (const QJsonValue& v : i_array)
+    {
+        list.append(v.toString());
+    }
+    return list;
+}
+
+SessionTrace::SessionTrace()
+{
+    trace_mode = off;
+    speed = 1.0;
+}
+
+bool SessionTrace::start_recording(const QString& i_file)
+{
+    trace_file.setFileName(i_file);
+    if (!trace_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        last_error = "Cannot open " + i_file + " for writing";
+        return false;
+    }
+    trace_mode = record;
+    clock.start();
+
+    QJsonObject header;
+    header["type"] = "header";
+    header["version"] = TRACE_VERSION;
+    header["started"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    header["anonymized"] = false;
+    write_line(header);
+    return true;
+}
+
+bool SessionTrace::start_replay(const QString& i_file, double i_speed)
+{
+    QFile in_file(i_file);
+    if (!in_file.open(QIODevice::ReadOnly))
+    {
+        last_error = "Cannot open " + i_file;
+        return false;
+    }
+
+    int line_number = 0;
+    while (!in_file.atEnd())
+    {
+        QByteArray line = in_file.readLine().trimmed();
+        line_number++;
+        if (line.isEmpty()) continue;
+
+        QJsonDocument doc = QJsonDocument::fromJson(line);
+        if (!doc.isObject())
+        {
+            last_error = QString("Invalid trace %1 at line %2").arg(i_file).arg(line_number);
+            return false;
+        }
+        QJsonObject obj = doc.object();
+        QString type = obj["type"].toString();
+        if (type == "header")
+        {
+            if (obj["version"].toInt() != TRACE_VERSION)
+            {
+                last_error = QString("Unsupported trace version %1").arg(obj["version"].toInt());
+                return false;
+            }
+        }
+        else if (type == "command")
+        {
+            command_event event;
+            event.command = obj["command"].toString();
+            event.args = to_string_list(obj["args"].toArray());
+            event.out = from_text(obj["stdout"]);
+            event.err = from_text(obj["stderr"]);
+            event.exit_code = obj["exit_code"].toInt();
+            event.timeout = obj["timeout"].toBool();
+            event.start_ms = static_cast<qint64>(obj["t_ms"].toDouble());
+            event.duration_ms = static_cast<qint64>(obj["duration_ms"].toDouble());
+            commands[command_line_key(event.command, event.args)].append(event);
+        }
+        else if (type == "file")
+        {
+            file_event event;
+            event.path = obj["path"].toString();
+            event.exists = obj["exists"].toBool();
+            event.readable = obj["readable"].toBool();
+            event.data = from_text(obj["data"]);
+            event.start_ms = static_cast<qint64>(obj["t_ms"].toDouble());
+            event.duration_ms = static_cast<qint64>(obj["duration_ms"].toDouble());
+            files[event.path].append(event);
+        }
+    }
+
+    trace_file.setFileName(i_file);
+    trace_mode = replay;
+    speed = i_speed;
+    return true;
+}
+
+SessionTrace::trace_mode_t SessionTrace::mode() const
+{
+    return trace_mode;
+}
+
+QString SessionTrace::file_name() const
+{
+    return trace_file.fileName();
+}
+
+QString SessionTrace::error() const
+{
+    return last_error;
+}
+
+qint64 SessionTrace::elapsed() const
+{
+    return (trace_mode == record) ? clock.elapsed() : 0;
+}
+
+void SessionTrace::record_command(const command_event& i_event)
+{
+    if (trace_mode != record) return;
+
+    QJsonObject obj;
+    obj["type"] = "command";
+    obj["t_ms"] = static_cast<double>(i_event.start_ms);
+    obj["duration_ms"] = static_cast<double>(i_event.duration_ms);
+    obj["command"] = i_event.command;
+    obj["args"] = QJsonArray::fromStringList(i_event.args);
+    obj["exit_code"] = i_event.exit_code;
+    obj["timeout"] = i_event.timeout;
+    obj["stdout"] = to_text(i_event.out);
+    obj["stderr"] = to_text(i_event.err);
+    write_line(obj);
+}
+
+void SessionTrace::record_file(const file_event& i_event)
+{
+    if (trace_mode != record) return;
+
+    QJsonObject obj;
+    obj["type"] = "file";
+    obj["t_ms"] = static_cast<double>(i_event.start_ms);
+    obj["duration_ms"] = static_cast<double>(i_event.duration_ms);
+    obj["path"] = i_event.path;
+    obj["exists"] = i_event.exists;
+    obj["readable"] = i_event.readable;
+    obj["data"] = to_text(i_event.data);
+    write_line(obj);
+}
+
+bool SessionTrace::replay_command(const QString& i_command, const QStringList& i_args, command_event& o_event)
+{
+    QString key = command_line_key(i_command, i_args);
+    if (!commands.contains(key)) return false;
+
+    const QList<command_event>& events = commands[key];
+    int pos = commands_pos.value(key, 0);
+    o_event = events[qMin(pos, events.size() - 1)];
+    commands_pos[key] = pos + 1;
+    return true;
+}
+
+bool SessionTrace::replay_file(const QString& i_path, file_event& o_event)
+{
+    if (!files.contains(i_path)) return false;
+
+    const QList<file_event>& events = files[i_path];
+    int pos = files_pos.value(i_path, 0);
+    o_event = events[qMin(pos, events.size() - 1)];
+    files_pos[i_path] = pos + 1;
+    return true;
+}
+
+void SessionTrace::wait(qint64 i_duration_ms) const
+{
+    if (speed <= 0 || i_duration_ms <= 0) return;
+    QThread::msleep(static_cast<unsigned long>(i_duration_ms / speed));
+}
+
+void SessionTrace::write_line(const QJsonObject& i_object)
+{
+    trace_file.write(QJsonDocument(i_object).toJson(QJsonDocument::Compact) + "\n");
+    // Flush each event, so that the trace survives a crash or a kill
+    trace_file.flush();
+}
+
+QString SessionTrace::command_line_key(const QString& i_command, const QStringList& i_args)
+{
+    return (QStringList() << i_command << i_args).join('\n');
+}
+
+// Replace every match of i_rx in i_text by i_replace(match)
+static QString replace_matches(const QString& i_text, const QRegularExpression& i_rx, std::function<QString(const QRegularExpressionMatch&)> i_replace)
+{
+    QString result;
+    int last = 0;
+    QRegularExpressionMatchIterator it = i_rx.globalMatch(i_text);
+    while (it.hasNext())
+    {
+        QRegularExpressionMatch match = it.next();
+        result += i_text.mid(last, match.capturedStart() - last);
+        result += i_replace(match);
+        last = match.capturedEnd();
+    }
+    result += i_text.mid(last);
+    return result;
+}
+
+// Salted hash: the same value always gets the same pseudonym within a trace
+static QString pseudonym(const QString& i_value, const QByteArray& i_salt, int i_length)
+{
+    QByteArray hash = QCryptographicHash::hash(i_salt + i_value.toLatin1(), QCryptographicHash::Sha256);
+    return QString::fromLatin1(hash.toHex().toUpper()).left(i_length);
+}
+
+// Fingerprints as printed by --fingerprint: "ABCD EF01 ... 2345  6789 ..."
+static const QRegularExpression rx_grouped_fp("\\b[0-9A-F]{4}(?: {1,2}[0-9A-F]{4}){9}\\b");
+// Fingerprints and keygrips
+static const QRegularExpression rx_fp("\\b[0-9A-F]{40}\\b");
+
+static QString anonymize_text(const QString& i_text, const QList<QPair<QString, QString> >& i_literals,
+                              const QHash<QString, QString>& i_key_ids, const QByteArray& i_salt)
+{
+    // Key ids, with or without "0x" (e.g. "openpgp:0x..." or "gpg: key ...:")
+    static const QRegularExpression rx_keyid("\\b(?:0x[0-9A-F]{8}|(?:0x)?[0-9A-F]{16})\\b");
+    // ssh public keys
+    static const QRegularExpression rx_ssh("\\b((?:ssh|ecdsa-sha2)-[A-Za-z0-9-]+) ([A-Za-z0-9+/]{16,}={0,2})");
+    // ssh fingerprints, e.g. in the comments written by gpg-agent in sshcontrol
+    static const QRegularExpression rx_ssh_md5("\\bMD5:(?:[0-9a-f]{2}:){15}[0-9a-f]{2}\\b");
+    static const QRegularExpression rx_ssh_sha256("\\bSHA256:[A-Za-z0-9+/]{43}");
+    // Smartcard serial numbers, in gpg -K output of card stubs
+    static const QRegularExpression rx_card_serial("(Card serial no\\. = )([0-9A-Fa-f ]*[0-9A-Fa-f])");
+
+    // Card serials keep their layout
+    QString text = replace_matches(i_text, rx_card_serial, [&](const QRegularExpressionMatch& m) {
+        QString serial = m.captured(2);
+        QString digits = pseudonym(QString(serial).remove(' '), i_salt, serial.size());
+        for (int i = 0, j = 0; i < serial.size(); i++)
+        {
+            if (serial[i] != ' ') serial[i] = digits[j++];
+        }
+        return m.captured(1) + serial;
+    });
+    // Fingerprints keep their layout
+    text = replace_matches(text, rx_grouped_fp, [&](const QRegularExpressionMatch& m) {
+        QString grouped = m.captured();
+        QString digits = pseudonym(QString(grouped).remove(' '), i_salt, 40);
+        for (int i = 0, j = 0; i < grouped.size(); i++)
+        {
+            if (grouped[i] != ' ') grouped[i] = digits[j++];
+        }
+        return grouped;
+    });
+    text = replace_matches(text, rx_fp, [&](const QRegularExpressionMatch& m) {
+        return pseudonym(m.captured(), i_salt, 40);
+    });
+    text = replace_matches(text, rx_ssh, [&](const QRegularExpressionMatch& m) {
+        QByteArray hash = QCryptographicHash::hash(i_salt + m.captured(2).toLatin1(), QCryptographicHash::Sha256);
+        return m.captured(1) + " " + QString::fromLatin1(hash.toBase64());
+    });
+    text = replace_matches(text, rx_ssh_md5, [&](const QRegularExpressionMatch& m) {
+        QString digits = pseudonym(m.captured(), i_salt, 32).toLower();
+        QStringList pairs;
+        for (int i = 0; i < digits.size(); i += 2) pairs.append(digits.mid(i, 2));
+        return "MD5:" + pairs.join(':');
+    });
+    text = replace_matches(text, rx_ssh_sha256, [&](const QRegularExpressionMatch& m) {
+        QByteArray hash = QCryptographicHash::hash(i_salt + m.captured().toLatin1(), QCryptographicHash::Sha256);
+        return "SHA256:" + QString::fromLatin1(hash.toBase64()).remove('=');
+    });
+    // Key ids of known fingerprints stay consistent with their pseudonym
+    text = replace_matches(text, rx_keyid, [&](const QRegularExpressionMatch& m) {
+        QString id = m.captured();
+        QString prefix = id.startsWith("0x") ? "0x" : "";
+        id.remove(0, prefix.size());
+        return prefix + i_key_ids.value(id, pseudonym(id, i_salt, id.size()));
+    });
+
+    // Then whole user ids, mails and gpg home, longest first, and never
+    // within a word: a short user id must not change unrelated text
+    for (const QPair<QString, QString>& literal : i_literals)
+    {
+        QRegularExpression rx_literal("(?<!\\w)" + QRegularExpression::escape(literal.first) + "(?!\\w)");
+        text.replace(rx_literal, literal.second);
+    }
+    return text;
+}
+
+bool SessionTrace::anonymize(const QString& i_in_file, const QString& i_out_file, QString& o_error)
+{
+    QFile in_file(i_in_file);
+    if (!in_file.open(QIODevice::ReadOnly))
+    {
+        o_error = "Cannot open " + i_in_file;
+        return false;
+    }
+    QList<QJsonObject> objects;
+    int line_number = 0;
+    while (!in_file.atEnd())
+    {
+        QByteArray line = in_file.readLine().trimmed();
+        line_number++;
+        if (line.isEmpty()) continue;
+        QJsonDocument doc = QJsonDocument::fromJson(line);
+        if (!doc.isObject())
+        {
+            o_error = QString("Invalid trace %1 at line %2").arg(i_in_file).arg(line_number);
+            return false;
+        }
+        objects.append(doc.object());
+    }
+    in_file.close();
+
+    // Salt of our own, pseudonyms cannot be matched with another trace
+    QByteArray salt = QUuid::createUuid().toByteArray();
+
+    // First gather personal data from gpg outputs: user ids and gpg home
+    QRegularExpression rx_uid("^uid +\\[[^\\]]*\\] (?<uid>[^\\r\\n]+)", QRegularExpression::MultilineOption);
+    QRegularExpression rx_uid_name("^(?<name>[^<(]*?) *(?:[<(]|$)");
+    QRegularExpression rx_uid_mail("<(?<mail>[^>]+)>");
+    QRegularExpression rx_home("Home: (?<home>[^\\r\\n]+)");
+    QHash<QString, QString> uids;
+    // Names alone are not replaced, they only number the pseudonyms
+    QHash<QString, QString> names;
+    QHash<QString, QString> mails;
+    QString home;
+    for (const QJsonObject& obj : objects)
+    {
+        if (obj["type"].toString() != "command") continue;
+        QString out = obj["stdout"].toString();
+        QRegularExpressionMatchIterator it = rx_uid.globalMatch(out);
+        while (it.hasNext())
+        {
+            // The whole user id goes: name, comment and mail
+            QString payload = it.next().captured("uid").trimmed();
+            QString name = rx_uid_name.match(payload).captured("name");
+            QString mail = rx_uid_mail.match(payload).captured("mail");
+            if (!name.isEmpty() && !names.contains(name))
+            {
+                names.insert(name, QString("User %1").arg(names.size() + 1));
+            }
+            if (!mail.isEmpty() && !mails.contains(mail))
+            {
+                mails.insert(mail, QString("user%1@example.invalid").arg(mails.size() + 1));
+            }
+            QStringList anonymous;
+            if (!name.isEmpty()) anonymous.append(names[name]);
+            if (!mail.isEmpty()) anonymous.append("<" + mails[mail] + ">");
+            uids.insert(payload, anonymous.join(' '));
+        }
+        if (home.isEmpty())
+        {
+            home = rx_home.match(out).captured("home");
+        }
+    }
+
+    QList<QPair<QString, QString> > literals;
+    for (auto it = uids.constBegin(); it != uids.constEnd(); ++it) literals.append(qMakePair(it.key(), it.value()));
+    for (auto it = mails.constBegin(); it != mails.constEnd(); ++it) literals.append(qMakePair(it.key(), it.value()));
+    if (!home.isEmpty()) literals.append(qMakePair(home, QString("/anonymized/gnupg")));
+    std::sort(literals.begin(), literals.end(), [](const QPair<QString, QString>& a, const QPair<QString, QString>& b) {
+        return a.first.size() > b.first.size();
+    });
+
+    // Key ids are the end of fingerprints: derive them from the fingerprint pseudonyms
+    QHash<QString, QString> key_ids;
+    for (const QJsonObject& obj : objects)
+    {
+        QString text = obj["stdout"].toString() + "\n" + obj["stderr"].toString() + "\n" + obj["data"].toString();
+        QStringList fingerprints;
+        QRegularExpressionMatchIterator it = rx_grouped_fp.globalMatch(text);
+        while (it.hasNext()) fingerprints.append(it.next().captured().remove(' '));
+        it = rx_fp.globalMatch(text);
+        while (it.hasNext()) fingerprints.append(it.next().captured());
+        for (const QString& fp : fingerprints)
+        {
+            QString anonymous = pseudonym(fp, salt, 40);
+            key_ids.insert(fp.right(16), anonymous.right(16));
+            key_ids.insert(fp.right(8), anonymous.right(8));
+        }
+    }
+
+    // Then rewrite every text field
+    QFile out_file(i_out_file);
+    if (!out_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        o_error = "Cannot open " + i_out_file + " for writing";
+        return false;
+    }
+    for (QJsonObject obj : objects)
+    {
+        QString type = obj["type"].toString();
+        if (type == "header")
+        {
+            obj["anonymized"] = true;
+        }
+        else if (type == "command")
+        {
+            // Arguments are the replay lookup keys: only identifiers are replaced there
+            QStringList args;
+            for (const QString& arg : to_string_list(obj["args"].toArray()))
+            {
+                args.append(anonymize_text(arg, QList<QPair<QString, QString> >(), key_ids, salt));
+            }
+            obj["args"] = QJsonArray::fromStringList(args);
+            obj["stdout"] = anonymize_text(obj["stdout"].toString(), literals, key_ids, salt);
+            obj["stderr"] = anonymize_text(obj["stderr"].toString(), literals, key_ids, salt);
+        }
+        else if (type == "file")
+        {
+            obj["path"] = anonymize_text(obj["path"].toString(), literals, key_ids, salt);
+            obj["data"] = anonymize_text(obj["data"].toString(), literals, key_ids, salt);
+        }
+        out_file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact) + "\n");
+    }
+    out_file.close();
+    return true;
+}
@@ -0,0 +1,130 @@
+/*
+Copyright (c) 2019 - Mathieu ALLORY
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef SESSIONTRACE_H
+#define SESSIONTRACE_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QJsonObject>
+
+// Record / replay of what gpghelper gets from the outside world
+// (commands run and files read), so that a user session can be
+// played again offline, without gpg, e.g. for profiling.
+// The trace is a text file, one JSON object per line.
+class SessionTrace
+{
+public:
+    enum trace_mode_t
+    {
+        off,
+        record,
+        replay
+    };
+
+    struct command_event
+    {
+        QString command;
+        QStringList args;
+        QByteArray out;
+        QByteArray err;
+        int exit_code;
+        // Did not finish in time (or could not start)
+        bool timeout;
+        // Start time since beginning of the session (see elapsed())
+        qint64 start_ms;
+        qint64 duration_ms;
+
+        command_event()
+        {
+            exit_code = -1;
+            timeout = false;
+            start_ms = 0;
+            duration_ms = 0;
+        }
+    };
+
+    struct file_event
+    {
+        QString path;
+        bool exists;
+        bool readable;
+        QByteArray data;
+        qint64 start_ms;
+        qint64 duration_ms;
+
+        file_event()
+        {
+            exists = false;
+            readable = false;
+            start_ms = 0;
+            duration_ms = 0;
+        }
+    };
+
+    SessionTrace();
+
+    bool start_recording(const QString& i_file);
+    bool start_replay(const QString& i_file, double i_speed);
+    trace_mode_t mode() const;
+    QString file_name() const;
+    QString error() const;
+    // Time since beginning of the recorded session (0 unless recording)
+    qint64 elapsed() const;
+
+    // Recording, does nothing unless in record mode
+    void record_command(const command_event& i_event);
+    void record_file(const file_event& i_event);
+
+    // Replay, events are given back in recorded order for the same
+    // command line (resp. path), the last one is repeated when exhausted
+    bool replay_command(const QString& i_command, const QStringList& i_args, command_event& o_event);
+    bool replay_file(const QString& i_path, file_event& o_event);
+    // Sleep for a recorded duration, scaled by replay speed (0 = no wait)
+    void wait(qint64 i_duration_ms) const;
+
+    // Write a copy of a trace with user ids, gpg home, fingerprints, key ids,
+    // keygrips, ssh keys and ssh fingerprints replaced by consistent pseudonyms
+    static bool anonymize(const QString& i_in_file, const QString& i_out_file, QString& o_error);
+
+private:
+    void write_line(const QJsonObject& i_object);
+    static QString command_line_key(const QString& i_command, const QStringList& i_args);
+
+private:
+    trace_mode_t trace_mode;
+    QFile trace_file;
+    QString last_error;
+    QElapsedTimer clock;
+    double speed;
+    QHash<QString, QList<command_event> > commands;
+    QHash<QString, int> commands_pos;
+    QHash<QString, QList<file_event> > files;
+    QHash<QString, int> files_pos;
+};
+
+#endif // SESSIONTRACE_H
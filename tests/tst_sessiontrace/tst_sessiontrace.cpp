@@ -0,0 +1,204 @@
+/*
+Copyright (c) 2019 - Mathieu ALLORY
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "sessiontrace.h"
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QRegularExpression>
+
+class TestSessionTrace : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void latin1_round_trip();
+    void exhausted_replay_repeats_last();
+    void anonymized_trace_replays();
+
+private:
+    static SessionTrace::command_event make_command(const QStringList& i_args, const QByteArray& i_out, const QByteArray& i_err = QByteArray());
+};
+
+SessionTrace::command_event TestSessionTrace::make_command(const QStringList& i_args, const QByteArray& i_out, const QByteArray& i_err)
+{
+    SessionTrace::command_event event;
+    event.command = "gpg";
+    event.args = i_args;
+    event.out = i_out;
+    event.err = i_err;
+    event.exit_code = 0;
+    event.duration_ms = 5;
+    return event;
+}
+
+void TestSessionTrace::latin1_round_trip()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString trace_file = dir.path() + "/trace.jsonl";
+
+    // Every byte value, as gpg outputs are not always valid UTF-8
+    QByteArray all_bytes;
+    for (int i = 0; i < 256; i++) all_bytes.append(static_cast<char>(i));
+
+    {
+        SessionTrace recorder;
+        QVERIFY(recorder.start_recording(trace_file));
+        recorder.record_command(make_command(QStringList() << "-k", all_bytes, all_bytes));
+        SessionTrace::file_event file;
+        file.path = "/gnupg/sshcontrol";
+        file.exists = true;
+        file.readable = true;
+        file.data = all_bytes;
+        recorder.record_file(file);
+    }
+
+    SessionTrace player;
+    QVERIFY(player.start_replay(trace_file, 0));
+    SessionTrace::command_event command;
+    QVERIFY(player.replay_command("gpg", QStringList() << "-k", command));
+    QCOMPARE(command.out, all_bytes);
+    QCOMPARE(command.err, all_bytes);
+    SessionTrace::file_event file;
+    QVERIFY(player.replay_file("/gnupg/sshcontrol", file));
+    QCOMPARE(file.data, all_bytes);
+}
+
+void TestSessionTrace::exhausted_replay_repeats_last()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString trace_file = dir.path() + "/trace.jsonl";
+
+    {
+        SessionTrace recorder;
+        QVERIFY(recorder.start_recording(trace_file));
+        recorder.record_command(make_command(QStringList() << "-k", "first"));
+        recorder.record_command(make_command(QStringList() << "-K", "other"));
+        recorder.record_command(make_command(QStringList() << "-k", "second"));
+    }
+
+    SessionTrace player;
+    QVERIFY(player.start_replay(trace_file, 0));
+    SessionTrace::command_event command;
+    QVERIFY(player.replay_command("gpg", QStringList() << "-k", command));
+    QCOMPARE(command.out, QByteArray("first"));
+    QVERIFY(player.replay_command("gpg", QStringList() << "-k", command));
+    QCOMPARE(command.out, QByteArray("second"));
+    QVERIFY(player.replay_command("gpg", QStringList() << "-k", command));
+    QCOMPARE(command.out, QByteArray("second"));
+    QVERIFY(!player.replay_command("gpg", QStringList() << "--version", command));
+}
+
+void TestSessionTrace::anonymized_trace_replays()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString trace_file = dir.path() + "/trace.jsonl";
+    QString anon_file = dir.path() + "/anon.jsonl";
+
+    const QString home = "C:/Users/alice/AppData/Roaming/gnupg";
+    const QString fp = "0123456789ABCDEF0123456789ABCDEF01234567";
+    const QString grouped_fp = "0123 4567 89AB CDEF 0123  4567 89AB CDEF 0123 4567";
+    const QString grip = "FEDCBA9876543210FEDCBA9876543210FEDCBA98";
+    const QString md5 = "MD5:0a:1b:2c:3d:4e:5f:60:71:82:93:a4:b5:c6:d7:e8:f9";
+    const QString sha256 = "SHA256:abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQ";
+
+    {
+        SessionTrace recorder;
+        QVERIFY(recorder.start_recording(trace_file));
+        recorder.record_command(make_command(QStringList() << "--version",
+            ("gpg (GnuPG) 2.2.4\r\nHome: " + home + "\r\n").toLatin1()));
+        recorder.record_command(make_command(QStringList() << "--with-keygrip" << "-k",
+            ("pub   rsa2048 2019-01-01 [SCA]\r\n"
+             "      " + grouped_fp + "\r\n"
+             "      Keygrip = " + grip + "\r\n"
+             "uid           [ultimate] Alice Liddell (Company X) <alice@example.com>\r\n"
+             "uid           [ultimate] Bob Only\r\n"
+             "uid           [ultimate] A\r\n\r\n").toLatin1(),
+            ("gpg: key " + fp.right(16) + ": \"Alice Liddell (Company X) <alice@example.com>\" not changed\r\n").toLatin1()));
+        recorder.record_command(make_command(QStringList() << "--with-keygrip" << "-K",
+            ("ssb>  rsa2048 2019-01-01 [A]\r\n"
+             "      Keygrip = " + grip + "\r\n"
+             "      Card serial no. = 0006 12345678\r\n").toLatin1()));
+        recorder.record_command(make_command(QStringList() << "--export-ssh-key" << fp + "!",
+            ("ssh-rsa AAAAB3NzaC1yc2EAAAADAQABAAABAQC openpgp:0x" + fp.right(8) + "\r\n").toLatin1()));
+        SessionTrace::file_event file;
+        file.path = home + "/sshcontrol";
+        file.exists = true;
+        file.readable = true;
+        file.data = ("# Fingerprints: " + md5 + "\n#               " + sha256 + "\n" + grip + " 0\n").toLatin1();
+        recorder.record_file(file);
+    }
+
+    QString error;
+    QVERIFY2(SessionTrace::anonymize(trace_file, anon_file, error), qPrintable(error));
+
+    // Nothing personal left
+    QFile anon(anon_file);
+    QVERIFY(anon.open(QIODevice::ReadOnly));
+    QString content = QString::fromUtf8(anon.readAll());
+    for (const QString& secret : QStringList() << "/alice/" << "alice@" << "Alice Liddell" << "Company X" << "Bob Only"
+                                               << fp << fp.right(16) << fp.right(8) << grip
+                                               << md5 << sha256 << "AAAAB3NzaC1yc2EAAAADAQABAAABAQC"
+                                               << "0006 12345678")
+    {
+        QVERIFY2(!content.contains(secret), qPrintable(secret));
+    }
+
+    // Follow the session as the tool would: values read back must lead to the next events
+    SessionTrace player;
+    QVERIFY(player.start_replay(anon_file, 0));
+    SessionTrace::command_event command;
+    QVERIFY(player.replay_command("gpg", QStringList() << "--version", command));
+    QString anon_home = QRegularExpression("Home: (?<home>[^\\r]*)").match(QString::fromLatin1(command.out)).captured("home");
+    QVERIFY(!anon_home.isEmpty());
+
+    QVERIFY(player.replay_command("gpg", QStringList() << "--with-keygrip" << "-k", command));
+    QString listing = QString::fromLatin1(command.out);
+    QVERIFY(listing.contains(QRegularExpression("uid +\\[ultimate\\] User 1 <user1@example.invalid>")));
+    // A short user id only replaces itself
+    QVERIFY(listing.contains(QRegularExpression("uid +\\[ultimate\\] User 3\\r\\n")));
+    QVERIFY(listing.contains("[SCA]"));
+    QVERIFY(QString::fromLatin1(command.err).contains("\"User 1 <user1@example.invalid>\" not changed"));
+    QString anon_fp = QRegularExpression("\\r\\n {6}(?<fp>[0-9A-F ]+)\\r\\n").match(listing).captured("fp").remove(' ');
+    QCOMPARE(anon_fp.size(), 40);
+    QString anon_grip = QRegularExpression("Keygrip = (?<grip>[0-9A-F]+)").match(listing).captured("grip");
+    QCOMPARE(anon_grip.size(), 40);
+    // Key ids stay consistent with their fingerprint
+    QVERIFY(QString::fromLatin1(command.err).contains(anon_fp.right(16)));
+
+    QVERIFY(player.replay_command("gpg", QStringList() << "--with-keygrip" << "-K", command));
+    QVERIFY(QString::fromLatin1(command.out).contains(QRegularExpression("Card serial no\\. = [0-9A-F]{4} [0-9A-F]{8}\\r\\n")));
+    QVERIFY(QString::fromLatin1(command.out).contains("Keygrip = " + anon_grip));
+
+    QVERIFY(player.replay_command("gpg", QStringList() << "--export-ssh-key" << anon_fp + "!", command));
+    QVERIFY(QString::fromLatin1(command.out).contains("openpgp:0x" + anon_fp.right(8)));
+
+    SessionTrace::file_event file;
+    QVERIFY(player.replay_file(anon_home + "/sshcontrol", file));
+    QVERIFY(file.data.contains(anon_grip.toLatin1()));
+}
+
+QTEST_APPLESS_MAIN(TestSessionTrace)
+
+#include "tst_sessiontrace.moc"
@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Unit tests for record / replay of sessions
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_sessiontrace
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../../src
+
+SOURCES += tst_sessiontrace.cpp\
+        ../../src/sessiontrace.cpp
+
+HEADERS  += ../../src/sessiontrace.h